@@ -4,9 +4,21 @@
  * This project: http://github.com/elliot-wasem/Fireplace
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ncurses.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 // quick color definitions, for ease of use.
 // colors declared inside main
@@ -33,6 +45,52 @@
 #define WINDOW_SIDE_LENGTH 13
 #define NUM_FLAKES (72) // number of flakes is 3 flakes per column in window
 
+// virtual clock units, in milliseconds
+#define HOUR_MS (60 * 60 * 1000LL)
+#define DAY_MS  (24 * HOUR_MS)
+
+// arena memory mode. It replaces the allocator on top of glibc's __libc_*
+// entry points, so it is only built against glibc. Every block is a power of
+// two of at least ARENA_MIN_BLOCK bytes. The pointer handed out is preceded
+// by an ARENA_HEADER byte header recording the block's size class and where
+// the block starts, which is further back for over-aligned requests.
+// Everything else is aligned to ARENA_HEADER, like glibc's malloc. The arena
+// is sized for ARENA_HEADROOM times the starting terminal area so that the
+// screen can grow a little without spilling over.
+#ifdef __GLIBC__
+#define ARENA_SUPPORTED      1
+#else
+#define ARENA_SUPPORTED      0
+#endif
+#define ARENA_HEADER         16
+#define ARENA_MIN_BLOCK      32
+#define ARENA_CLASSES        26
+#define ARENA_BASE_BYTES     (512 * 1024)
+#define ARENA_BYTES_PER_CELL 32
+#define ARENA_HEADROOM       4
+
+// soak mode. Frame times are bucketed log-linearly, 2^SOAK_SUB_BITS buckets
+// per power of two nanoseconds, so percentiles are good to about 3% without
+// keeping every sample. A line of stats is printed per SOAK_WINDOW_MS of
+// virtual time. The screen is switched between the sizes in soak_sizes,
+// each held for SOAK_WARMUP_FRAMES first before anything is measured. For
+// judging frame time, every SOAK_SAMPLE_FRAMES frames at one size are timed
+// against a loop over SOAK_REFERENCE_BYTES, see soak_reference_ns().
+#define SOAK_SUB_BITS        5
+#define SOAK_BUCKETS         (64 << SOAK_SUB_BITS)
+#define SOAK_WINDOW_MS       HOUR_MS
+#define SOAK_MAX_DAYS        (LLONG_MAX / 2 / DAY_MS) // keeps the virtual clock from overflowing
+#define SOAK_RESIZE_MS       (60 * 1000)     // mean virtual time between resizes
+#define SOAK_KEY_MS          (60 * 1000)     // mean virtual time between keypresses
+#define SOAK_NUM_SIZES       6
+#define SOAK_WARMUP_FRAMES   4
+#define SOAK_MIN_FRAMES      1200 // frames a size needs in each half to compare output
+#define SOAK_SAMPLE_FRAMES   60
+#define SOAK_REFERENCE_BYTES (64 * 1024)
+#define SOAK_MEMORY_SLACK_KB 256  // second-half memory growth tolerated
+#define SOAK_TIME_DRIFT      20   // last-third growth of the fastest frame time tolerated, %
+#define SOAK_OUTPUT_DRIFT    10   // second-half output growth tolerated, %
+
 typedef struct {
     int x;
     int y;
@@ -45,8 +103,38 @@ typedef enum {
 
 typedef point dimensions;
 
+typedef struct {
+    size_t class;
+    size_t offset;              // bytes from the start of the block to the header
+} arena_header;
+
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    size_t top;                 // bump pointer, bytes of arena ever handed out
+    size_t in_use;              // bytes currently handed out
+    size_t peak;                // high-water mark of in_use
+    size_t allocations;         // every malloc/calloc/realloc call seen
+    size_t steady_allocations;  // allocations made by steady-state frames
+    size_t overflows;           // requests the arena could not satisfy
+    void *free_lists[ARENA_CLASSES];
+} arena_t;
+
+typedef struct {
+    unsigned frame_ns[SOAK_BUCKETS];  // frame time histogram, see soak_bucket()
+    size_t frames;
+    size_t output_bytes;
+    long rss_kb;                      // largest RSS sampled
+    size_t arena_used;                // arena high-water mark at the end
+} soak_stats;
+
+typedef struct {
+    double fastest;             // lowest frame time over reference time of any sample
+    size_t samples;
+} soak_pace;
+
 // time used to set delay between each frame
-static int time = 250;
+static int delay = 250;
 
 // stores size of screen
 static dimensions screen_size = (dimensions){0, 0};
@@ -62,6 +150,49 @@ static point flakes[NUM_FLAKES]; // 2 * 3, 2 for the number of pixels
 // wreathe position, used for offset of wreathe in draw_wreathe().
 static point wreathe_pos = (point){.y=-27, .x=10};
 
+// set by -a/--arena. All heap memory, ncurses' screen buffers included, is
+// then carved out of a single arena mapped before the screen is initialized.
+static int arena_mode = 0;
+static arena_t arena;
+
+// virtual clock, in milliseconds. Advances by one frame delay per frame,
+// whether or not anything actually waited for it.
+static long long clock_ms = 0;
+
+// set by -s/--soak: virtual milliseconds to run for. The scene is then drawn
+// off screen as fast as it can be, with random resizes and keypresses fed
+// into the main loop, and frame time, memory and output are recorded.
+static long long soak_ms = 0;
+static int soak_out = -1;
+static unsigned long long soak_rand_state = 0x2545f4914f6cdd1dULL;
+static soak_stats soak_window;
+static soak_stats soak_half[2];
+static soak_stats soak_costs[SOAK_NUM_SIZES][2];  // per screen size and half
+static soak_pace soak_paces[SOAK_NUM_SIZES][2];   // per screen size, first and last third
+static int soak_sample_size = -1;
+static int soak_sample_part = -1;
+static int soak_sample_frames = 0;
+static long long soak_sample_ns = 0;              // fastest frame of the sample so far
+static long long soak_sample_reference_ns = 0;    // and fastest reference loop
+
+// screen sizes a soak run switches between, all big enough for the scene
+static const dimensions soak_sizes[SOAK_NUM_SIZES] = {
+    {.y=31, .x=81}, {.y=40, .x=100}, {.y=43, .x=132},
+    {.y=50, .x=160}, {.y=60, .x=200}, {.y=70, .x=220},
+};
+static int soak_size = 0;
+
+#if ARENA_SUPPORTED
+// glibc's own allocator, used whenever the arena is off or full.
+// malloc_usable_size() has no __libc_ alias and is looked up on first use.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+static size_t (*libc_malloc_usable_size)(void *ptr);
+#endif
+
 void initialize_program();
 void initialize_colors();
 void cleanup_program();
@@ -74,11 +205,44 @@ void draw_window();
 void draw_wall();
 void draw_fireplace();
 void draw_greeting();
+void arena_init();
+int arena_report();
+long long soak_now_ns();
+void soak_input();
+void soak_record_frame(long long frame_ns);
+int soak_report();
 
 int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (ARENA_SUPPORTED && (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--arena") == 0)) {
+            arena_mode = 1;
+        } else if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--soak") == 0) &&
+                   i + 1 < argc) {
+            double days = atof(argv[++i]);
+            if (!(days * DAY_MS >= delay && days < SOAK_MAX_DAYS)) {
+                fprintf(stderr, "fireplace: --soak takes from one frame up to %lld days\n",
+                        SOAK_MAX_DAYS);
+                return 1;
+            }
+            soak_ms = (long long)(days * DAY_MS);
+        } else {
+            fprintf(stderr, "usage: %s %s[-s|--soak DAYS]\n", argv[0],
+                    ARENA_SUPPORTED ? "[-a|--arena] " : "");
+            return 1;
+        }
+    }
+    if (arena_mode) {
+        arena_init();
+    }
+
     initialize_program();
-    char c = '\0';
+    int c = '\0';
+    int frame = 0;
+    int settle = 0;
+    dimensions last_size = screen_size;
     while (c != 'q') {
+        size_t allocations = arena.allocations;
+        long long frame_start = soak_ms ? soak_now_ns() : 0;
         getmaxyx(stdscr, screen_size.y, screen_size.x);
         if (screen_size.y > 30 && screen_size.x > 80) {
             draw_scene();
@@ -87,15 +251,56 @@ int main(int argc, char *argv[]) {
             mvprintw(0, 0, "Please increase screen size");
             refresh();
         }
+        if (soak_ms) {
+            soak_input();
+        }
         c = getch();
+        clock_ms += delay;
+        long long frame_ns = soak_ms ? soak_now_ns() - frame_start : 0;
+
+        // ncurses allocates while drawing the first frame. On a resize it
+        // reallocates its windows in the frame getch() reports KEY_RESIZE,
+        // then again in the full repaint at the new size and in the first
+        // update after that, which regrows its scrolling hash tables. Every
+        // other frame is steady state and must not touch the heap.
+        int resized = screen_size.y != last_size.y || screen_size.x != last_size.x;
+        if (frame++ > 0 && c != KEY_RESIZE && !resized && !settle) {
+            arena.steady_allocations += arena.allocations - allocations;
+        }
+        settle = resized;
+        last_size = screen_size;
+
+        if (soak_ms) {
+            soak_record_frame(frame_ns);
+        }
     }
     cleanup_program();
+    int status = 0;
+    if (soak_ms) {
+        status |= soak_report();
+    }
+    if (arena_mode) {
+        status |= arena_report();
+    }
+    return status;
 }
 
 void initialize_program() {
 
-    // initialize screen
-    initscr();
+    // initialize screen. A soak run draws into a scratch file instead of the
+    // terminal, which soak_record_frame() measures and empties every frame.
+    if (soak_ms) {
+        FILE *out = tmpfile();
+        FILE *in = fopen("/dev/null", "r");
+        if (!out || !in || !newterm(getenv("TERM") ? NULL : "xterm", out, in)) {
+            fprintf(stderr, "fireplace: cannot start soak screen\n");
+            exit(1);
+        }
+        soak_out = fileno(out);
+        resizeterm(soak_sizes[0].y, soak_sizes[0].x);
+    } else {
+        initscr();
+    }
 
     // initializes color
     start_color();
@@ -113,7 +318,7 @@ void initialize_program() {
      * sets getch timeout (and I assume other hanging operations' timeouts, but
      * I haven't confirmed that). This is used for the timing functionality
      */
-    timeout(time);
+    timeout(soak_ms ? 0 : delay);
 
     initialize_colors();
 
@@ -127,6 +332,528 @@ void initialize_program() {
     getmaxyx(stdscr, screen_size.y, screen_size.x);
 }
 
+/*
+ * maps the arena. Sized from the terminal before ncurses is started, since
+ * ncurses' own window buffers are the bulk of what ends up in it.
+ */
+void arena_init() {
+    struct winsize ws;
+    size_t cells = 80 * 24;
+    if (soak_ms) {
+        for (int i = 0; i < SOAK_NUM_SIZES; i++) {
+            if ((size_t)soak_sizes[i].y * soak_sizes[i].x > cells) {
+                cells = (size_t)soak_sizes[i].y * soak_sizes[i].x;
+            }
+        }
+    } else if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+        cells = (size_t)ws.ws_row * ws.ws_col;
+    }
+    size_t size = ARENA_BASE_BYTES + cells * ARENA_BYTES_PER_CELL * ARENA_HEADROOM;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("fireplace: arena");
+        exit(1);
+    }
+    arena.size = size;
+    arena.base = base;
+}
+
+#if ARENA_SUPPORTED
+static int arena_owns(void *ptr) {
+    unsigned char *p = ptr;
+    return arena.base && p >= arena.base && p < arena.base + arena.size;
+}
+
+static arena_header *arena_header_of(void *ptr) {
+    return (arena_header *)((unsigned char *)ptr - ARENA_HEADER);
+}
+
+static size_t arena_usable_size(void *ptr) {
+    arena_header *h = arena_header_of(ptr);
+    return ((size_t)ARENA_MIN_BLOCK << h->class) - h->offset - ARENA_HEADER;
+}
+
+/*
+ * hands out a block from the free list of the smallest size class that fits
+ * the request and its alignment, or from the top of the arena. Returns NULL
+ * once the arena is exhausted.
+ */
+static void *arena_alloc(size_t alignment, size_t size) {
+    size_t slack = alignment > ARENA_HEADER ? alignment - ARENA_HEADER : 0;
+    if (size > (size_t)-1 - slack - ARENA_HEADER) {
+        return NULL;
+    }
+    size_t class = 0;
+    while (((size_t)ARENA_MIN_BLOCK << class) - ARENA_HEADER < size + slack) {
+        if (++class == ARENA_CLASSES) {
+            return NULL;
+        }
+    }
+    size_t block = (size_t)ARENA_MIN_BLOCK << class;
+    unsigned char *p = arena.free_lists[class];
+    if (p) {
+        arena.free_lists[class] = *(void **)p;
+    } else if (arena.size - arena.top >= block) {
+        p = arena.base + arena.top;
+        arena.top += block;
+    } else {
+        return NULL;
+    }
+    unsigned char *user = p + ARENA_HEADER;
+    if (slack) {
+        user += (alignment - (uintptr_t)user % alignment) % alignment;
+    }
+    arena_header *h = arena_header_of(user);
+    h->class = class;
+    h->offset = user - ARENA_HEADER - p;
+    arena.in_use += block;
+    if (arena.in_use > arena.peak) {
+        arena.peak = arena.in_use;
+    }
+    return user;
+}
+
+static void arena_free(void *ptr) {
+    arena_header *h = arena_header_of(ptr);
+    size_t class = h->class;
+    unsigned char *p = (unsigned char *)h - h->offset;
+    *(void **)p = arena.free_lists[class];
+    arena.free_lists[class] = p;
+    arena.in_use -= (size_t)ARENA_MIN_BLOCK << class;
+}
+
+// every allocation goes through here, and into the arena if it is on
+static void *allocate(size_t alignment, size_t size) {
+    arena.allocations++;
+    void *p = arena.base ? arena_alloc(alignment, size) : NULL;
+    if (!p) {
+        arena.overflows += arena.base != NULL;
+        p = alignment > ARENA_HEADER ? __libc_memalign(alignment, size) : __libc_malloc(size);
+    }
+    return p;
+}
+
+/*
+ * the allocator entry points, replacing glibc's for the whole process
+ * (ncurses included). glibc requires the full set to be replaced together.
+ * With the arena off they only count calls and pass them on.
+ */
+void *malloc(size_t size) {
+    return allocate(ARENA_HEADER, size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (!arena.base) {
+        arena.allocations++;
+        return __libc_calloc(nmemb, size);
+    }
+    if (size && nmemb > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = malloc(nmemb * size);
+    if (p) {
+        memset(p, 0, nmemb * size);
+    }
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (alignment & (alignment - 1)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return allocate(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    void *p = allocate(alignment, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void *valloc(size_t size) {
+    return allocate(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return allocate(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (arena_owns(ptr)) {
+        return arena_usable_size(ptr);
+    }
+    if (!libc_malloc_usable_size) {
+        libc_malloc_usable_size = (size_t (*)(void *))dlsym(RTLD_NEXT, "malloc_usable_size");
+    }
+    return libc_malloc_usable_size(ptr);
+}
+
+/*
+ * grows or shrinks in place when the block allows it. With the arena on,
+ * blocks from glibc (handed out before the arena was mapped) are moved into
+ * it on their next realloc.
+ */
+void *realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+    if (!arena.base) {
+        arena.allocations++;
+        return __libc_realloc(ptr, size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    size_t have = malloc_usable_size(ptr);
+    if (arena_owns(ptr) && size <= have) {
+        return ptr;
+    }
+    void *p = malloc(size);
+    if (!p) {
+        return NULL;
+    }
+    memcpy(p, ptr, have < size ? have : size);
+    free(ptr);
+    return p;
+}
+
+void free(void *ptr) {
+    if (arena_owns(ptr)) {
+        arena_free(ptr);
+    } else {
+        __libc_free(ptr);
+    }
+}
+#endif
+
+// read with plain syscalls, since soak mode samples it mid-run
+static long read_status_kb(const char *field) {
+    char buf[4096];
+    int fd = open("/proc/self/status", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    char *line = strstr(buf, field);
+    return line ? strtol(line + strlen(field), NULL, 10) : -1;
+}
+
+/*
+ * prints arena and RSS usage to stderr. Returns the exit status: nonzero if
+ * any steady-state frame touched the heap, or if anything had to be
+ * allocated outside the arena.
+ */
+int arena_report() {
+    int status = 0;
+    fprintf(stderr, "arena: %zu KiB reserved, %zu KiB used, %zu KiB peak live, %zu overflows\n",
+            arena.size / 1024, arena.top / 1024, arena.peak / 1024, arena.overflows);
+    fprintf(stderr, "rss: %ld KiB peak, %ld KiB at exit\n",
+            read_status_kb("VmHWM:"), read_status_kb("VmRSS:"));
+    if (arena.overflows) {
+        fprintf(stderr, "arena: FAIL, %zu allocations did not fit in the arena\n",
+                arena.overflows);
+        status = 1;
+    }
+    if (arena.steady_allocations) {
+        fprintf(stderr, "arena: FAIL, %zu allocations in steady-state frames\n",
+                arena.steady_allocations);
+        status = 1;
+    }
+    if (!status) {
+        fprintf(stderr, "arena: ok, no allocations after the first frame, "
+                "other than the three frames around each resize\n");
+    }
+    return status;
+}
+
+// frames are timed in this thread's CPU time, which leaves out time spent
+// waiting for the CPU, but not the CPU itself running slower: clock changes
+// and other processes contending for its caches still move frame times by
+// tens of percent. soak_reference_ns() is what corrects for that.
+long long soak_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift64, kept apart from rand() so the snow falls as it normally would
+static unsigned soak_rand(unsigned bound) {
+    soak_rand_state ^= soak_rand_state << 13;
+    soak_rand_state ^= soak_rand_state >> 7;
+    soak_rand_state ^= soak_rand_state << 17;
+    return soak_rand_state % bound;
+}
+
+// virtual time spent visiting every screen size once, before measuring
+static long long soak_warmup_ms() {
+    return (long long)SOAK_NUM_SIZES * SOAK_WARMUP_FRAMES * delay;
+}
+
+static void soak_resize(int size) {
+    soak_size = size;
+    resizeterm(soak_sizes[size].y, soak_sizes[size].x);
+}
+
+/*
+ * queues up what a user would have done during this frame, to be read by
+ * the main loop's getch(): the odd keypress, the odd resize (resizeterm()
+ * queues the KEY_RESIZE itself) and finally 'q' on the run's last frame.
+ * The warm-up goes through every size in turn, so that memory has seen its
+ * peak before the first half of the run starts.
+ */
+void soak_input() {
+    long long frame = clock_ms / delay;
+    if (clock_ms + delay >= soak_ms) {
+        ungetch('q');
+    } else if (clock_ms < soak_warmup_ms()) {
+        if (frame % SOAK_WARMUP_FRAMES == SOAK_WARMUP_FRAMES - 1) {
+            soak_resize((frame / SOAK_WARMUP_FRAMES + 1) % SOAK_NUM_SIZES);
+        }
+    } else if (soak_rand(SOAK_RESIZE_MS / delay) == 0) {
+        soak_resize((soak_size + 1 + soak_rand(SOAK_NUM_SIZES - 1)) % SOAK_NUM_SIZES);
+    } else if (soak_rand(SOAK_KEY_MS / delay) == 0) {
+        ungetch("abcdefghijklmnoprstuvwxyz "[soak_rand(26)]);
+    }
+}
+
+/*
+ * maps a frame time to its histogram bucket. Below 2^SOAK_SUB_BITS ns every
+ * value has its own bucket; above, each power of two is split evenly.
+ */
+static int soak_bucket(unsigned long long ns) {
+    if (ns < (1 << SOAK_SUB_BITS)) {
+        return ns;
+    }
+    int shift = 63 - __builtin_clzll(ns) - SOAK_SUB_BITS;
+    return ((shift + 1) << SOAK_SUB_BITS) + (ns >> shift) - (1 << SOAK_SUB_BITS);
+}
+
+// smallest frame time in the bucket holding the given percentile
+static double soak_percentile_us(const soak_stats *stats, double percentile) {
+    size_t rank = (size_t)((stats->frames - 1) * percentile / 100);
+    size_t seen = 0;
+    int bucket = 0;
+    while (bucket < SOAK_BUCKETS - 1 && (seen += stats->frame_ns[bucket]) <= rank) {
+        bucket++;
+    }
+    if (bucket < (1 << SOAK_SUB_BITS)) {
+        return bucket / 1000.0;
+    }
+    int shift = (bucket >> SOAK_SUB_BITS) - 1;
+    unsigned long long mantissa = (bucket & ((1 << SOAK_SUB_BITS) - 1)) + (1 << SOAK_SUB_BITS);
+    return (mantissa << shift) / 1000.0;
+}
+
+static void soak_add(soak_stats *stats, long long frame_ns, size_t output_bytes, long rss_kb) {
+    stats->frame_ns[soak_bucket(frame_ns)]++;
+    stats->frames++;
+    stats->output_bytes += output_bytes;
+    if (rss_kb > stats->rss_kb) {
+        stats->rss_kb = rss_kb;
+    }
+    stats->arena_used = arena.top;
+}
+
+/*
+ * times a fixed loop over a buffer about the size of a frame's working set,
+ * once per frame. Whatever slows the machine down slows this down as well,
+ * while nothing the scene does can, so frame times are judged as a multiple
+ * of it.
+ */
+static long long soak_reference_ns() {
+    static volatile unsigned char buffer[SOAK_REFERENCE_BYTES];
+    long long start = soak_now_ns();
+    for (int pass = 0; pass < 8; pass++) {
+        for (size_t i = 0; i < sizeof(buffer); i += 64) {
+            buffer[i] += buffer[(i * 7 + pass) % sizeof(buffer)] ^ pass;
+        }
+    }
+    return soak_now_ns() - start;
+}
+
+/*
+ * keeps the fastest frame and the fastest run of soak_reference_ns() over
+ * SOAK_SAMPLE_FRAMES frames at one size, in one part of the run, and then
+ * the lowest ratio of the two seen for that size and part. A slow patch on
+ * the machine can only push the ratio up, so the lowest one is the most
+ * repeatable. Part -1 is the middle third, which is not compared.
+ */
+static void soak_pace_frame(int size, int part, long long frame_ns) {
+    if (size != soak_sample_size || part != soak_sample_part) {
+        soak_sample_size = size;
+        soak_sample_part = part;
+        soak_sample_frames = 0;
+    }
+    if (size < 0 || part < 0) {
+        return;
+    }
+    long long reference_ns = soak_reference_ns();
+    if (!soak_sample_frames || frame_ns < soak_sample_ns) {
+        soak_sample_ns = frame_ns;
+    }
+    if (!soak_sample_frames || reference_ns < soak_sample_reference_ns) {
+        soak_sample_reference_ns = reference_ns;
+    }
+    if (++soak_sample_frames == SOAK_SAMPLE_FRAMES) {
+        soak_pace *pace = &soak_paces[size][part];
+        double ratio = (double)soak_sample_ns / soak_sample_reference_ns;
+        if (!pace->samples++ || ratio < pace->fastest) {
+            pace->fastest = ratio;
+        }
+        soak_sample_frames = 0;
+    }
+}
+
+/*
+ * adds a frame to the current window and half of the run, and to the cost
+ * of the screen size it was drawn at, emptying the scratch file ncurses drew
+ * it into. Prints the window once it is full. Warm-up frames are not kept.
+ */
+void soak_record_frame(long long frame_ns) {
+    off_t output_bytes = lseek(soak_out, 0, SEEK_CUR);
+    if (output_bytes < 0 || ftruncate(soak_out, 0) != 0 || lseek(soak_out, 0, SEEK_SET) != 0) {
+        // carrying on would count every earlier frame's output again
+        int error = errno;
+        endwin();
+        fprintf(stderr, "fireplace: soak screen: %s\n", strerror(error));
+        exit(1);
+    }
+    if (clock_ms <= soak_warmup_ms()) {
+        return;
+    }
+
+    long rss_kb = read_status_kb("VmRSS:");
+    int half = clock_ms > soak_warmup_ms() + (soak_ms - soak_warmup_ms()) / 2;
+    soak_add(&soak_window, frame_ns, output_bytes, rss_kb);
+    soak_add(&soak_half[half], frame_ns, output_bytes, rss_kb);
+    int size = -1;
+    for (int i = 0; i < SOAK_NUM_SIZES; i++) {
+        if (soak_sizes[i].y == screen_size.y && soak_sizes[i].x == screen_size.x) {
+            size = i;
+            soak_add(&soak_costs[i][half], frame_ns, output_bytes, rss_kb);
+        }
+    }
+    long long third = (soak_ms - soak_warmup_ms()) / 3;
+    soak_pace_frame(size, clock_ms <= soak_warmup_ms() + third ? 0 :
+                          clock_ms > soak_ms - third ? 1 : -1, frame_ns);
+
+    if (soak_window.frames && (clock_ms % SOAK_WINDOW_MS == 0 || clock_ms >= soak_ms)) {
+        fprintf(stderr, "soak: day %3lld %02lld:%02lld %6zu frames  p50 %7.1fus  p95 %7.1fus"
+                "  p99 %7.1fus  max %8.1fus  %6zu B/frame  rss %ld KiB  arena %zu KiB\n",
+                clock_ms / DAY_MS, clock_ms / HOUR_MS % 24,
+                clock_ms / 60000 % 60, soak_window.frames,
+                soak_percentile_us(&soak_window, 50), soak_percentile_us(&soak_window, 95),
+                soak_percentile_us(&soak_window, 99), soak_percentile_us(&soak_window, 100),
+                soak_window.output_bytes / soak_window.frames, soak_window.rss_kb,
+                arena.top / 1024);
+        memset(&soak_window, 0, sizeof(soak_window));
+    }
+}
+
+/*
+ * compares the second half of the run against the first. Memory still
+ * growing after the warm-up is flagged. So is the output getting bigger at
+ * any screen size seen often enough in both halves; the scene's cost does
+ * not scale evenly with screen size, so sizes are never compared against
+ * each other. Frame time is judged on the fastest frames at each size,
+ * against the reference loop, last third of the run against the first, so a
+ * steady slowdown shows at two thirds of its size. Short runs can still
+ * swing by about 15% that way, which is what SOAK_TIME_DRIFT allows for.
+ * Returns the exit status.
+ */
+int soak_report() {
+    soak_stats *first = &soak_half[0], *second = &soak_half[1];
+    int regressions = 0;
+    if (!first->frames || !second->frames) {
+        fprintf(stderr, "soak: run too short to compare\n");
+        return 0;
+    }
+    fprintf(stderr, "soak: %.1f virtual hours, first half vs second: p50 %.1fus vs %.1fus, "
+            "rss %ld vs %ld KiB, arena %zu vs %zu KiB\n",
+            (double)clock_ms / HOUR_MS,
+            soak_percentile_us(first, 50), soak_percentile_us(second, 50),
+            first->rss_kb, second->rss_kb, first->arena_used / 1024, second->arena_used / 1024);
+    if (second->rss_kb > first->rss_kb + SOAK_MEMORY_SLACK_KB) {
+        fprintf(stderr, "soak: REGRESSION, rss grew by %ld KiB\n", second->rss_kb - first->rss_kb);
+        regressions++;
+    }
+    if (second->arena_used > first->arena_used + SOAK_MEMORY_SLACK_KB * 1024) {
+        fprintf(stderr, "soak: REGRESSION, arena grew by %zu KiB\n",
+                (second->arena_used - first->arena_used) / 1024);
+        regressions++;
+    }
+    for (int i = 0; i < SOAK_NUM_SIZES; i++) {
+        soak_stats *cost = soak_costs[i];
+        if (cost[0].frames < SOAK_MIN_FRAMES || cost[1].frames < SOAK_MIN_FRAMES) {
+            continue;
+        }
+        double us[2], bytes[2];
+        for (int h = 0; h < 2; h++) {
+            us[h] = soak_percentile_us(&cost[h], 50);
+            bytes[h] = (double)cost[h].output_bytes / cost[h].frames;
+        }
+        fprintf(stderr, "soak: %3dx%-3d %6zu vs %6zu frames, p50 %7.1f vs %7.1fus, "
+                "%6.0f vs %6.0f B/frame\n", soak_sizes[i].x, soak_sizes[i].y,
+                cost[0].frames, cost[1].frames, us[0], us[1], bytes[0], bytes[1]);
+        if (bytes[1] * 100 > bytes[0] * (100 + SOAK_OUTPUT_DRIFT)) {
+            fprintf(stderr, "soak: REGRESSION, output at %dx%d grew from %.0f to %.0f B/frame\n",
+                    soak_sizes[i].x, soak_sizes[i].y, bytes[0], bytes[1]);
+            regressions++;
+        }
+    }
+
+    // one size on its own is too noisy, so the sizes are pooled, each
+    // weighted by the samples it has in the thinner of its two thirds
+    double growth = 0, weight = 0;
+    for (int i = 0; i < SOAK_NUM_SIZES; i++) {
+        soak_pace *pace = soak_paces[i];
+        double samples = pace[0].samples < pace[1].samples ? pace[0].samples : pace[1].samples;
+        if (samples) {
+            growth += samples * (pace[1].fastest / pace[0].fastest - 1) * 100;
+            weight += samples;
+        }
+    }
+    if (!weight) {
+        fprintf(stderr, "soak: no screen size timed in both the first and last third, "
+                "frame time not compared\n");
+    } else {
+        growth /= weight;
+        fprintf(stderr, "soak: fastest frame time against the reference, last third vs "
+                "first: %+.1f%% over %.0f samples\n", growth, weight);
+        if (growth > SOAK_TIME_DRIFT) {
+            fprintf(stderr, "soak: REGRESSION, fastest frame time grew %.1f%%\n", growth);
+            regressions++;
+        }
+    }
+    if (!regressions) {
+        fprintf(stderr, "soak: ok, no regressions\n");
+    }
+    return regressions ? 1 : 0;
+}
+
 void initialize_colors() {
 
     // sets color pairs to numbers defined above